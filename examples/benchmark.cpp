@@ -0,0 +1,88 @@
+#include "clock_offset_udp_server.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Compares the jitter of offsets measured between two services on loopback when running them
+ * with the default reactor ('run') and with the busy poll run mode, at different request rates.
+ */
+
+struct jitter {
+    std::size_t samples;
+    double mean;
+    double stddev;
+    double p99;
+};
+
+jitter measure(bool busy_poll, int requests_per_second, std::chrono::milliseconds duration, uint16_t port) {
+    cofetcher::ClockOffsetService service1(port, 20);
+    cofetcher::ClockOffsetService service2(port + 1, 20);
+
+    std::mutex offsets_mutex;
+    std::vector<int32_t> offsets;
+    service1.subscribe([&](cofetcher::endpoint &, int32_t offset, int32_t, bool &) {
+        std::lock_guard<std::mutex> guard(offsets_mutex);
+        offsets.push_back(offset);
+    });
+
+    auto run = [busy_poll, duration](cofetcher::ClockOffsetService &service, int cpu) {
+        if (busy_poll) {
+            cofetcher::ClockOffsetService::busy_poll_options options;
+            options.cpu = cpu < (int) std::thread::hardware_concurrency() ? cpu : -1;
+            options.socket_busy_poll = 50;
+            service.run_busy_poll_for(duration, options);
+        } else {
+            service.run_for(duration);
+        }
+    };
+
+    std::thread thread1([&]{ run(service1, 0); });
+    std::thread thread2([&]{ run(service2, 1); });
+
+    cofetcher::endpoint endpoint(asio::ip::make_address("127.0.0.1"), port + 1);
+    auto interval = std::chrono::nanoseconds(1000000000 / requests_per_second);
+    auto end = std::chrono::steady_clock::now() + duration - std::chrono::milliseconds(100);
+    for (auto next = std::chrono::steady_clock::now(); next < end; next += interval) {
+        service1.init_single_time_request(endpoint);
+        std::this_thread::sleep_until(next);
+    }
+
+    thread1.join();
+    thread2.join();
+
+    std::lock_guard<std::mutex> guard(offsets_mutex);
+    jitter result{offsets.size(), 0, 0, 0};
+    if (offsets.empty()) return result;
+
+    for (int32_t o : offsets) result.mean += (double) o / offsets.size();
+    std::vector<double> deviations;
+    for (int32_t o : offsets) {
+        result.stddev += (o - result.mean) * (o - result.mean) / offsets.size();
+        deviations.push_back(std::abs(o - result.mean));
+    }
+    result.stddev = std::sqrt(result.stddev);
+    std::sort(deviations.begin(), deviations.end());
+    result.p99 = deviations[(std::size_t) (deviations.size() * 0.99)];
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+
+    uint16_t port = argc > 1 ? (uint16_t) std::stol(argv[1]) : 4000;
+    std::chrono::milliseconds duration(argc > 2 ? std::stol(argv[2]) : 2000);
+
+    std::cout << "mode       requests/s  samples   mean(ns)  stddev(ns)  p99 |dev|(ns)" << std::endl;
+    for (int requests_per_second : {10, 100, 1000, 10000}) {
+        for (bool busy_poll : {false, true}) {
+            jitter j = measure(busy_poll, requests_per_second, duration, port);
+            std::printf("%-10s %10d %8zu %10.0f %11.0f %14.0f\n", busy_poll ? "busy_poll" : "run",
+                        requests_per_second, j.samples, j.mean, j.stddev, j.p99);
+        }
+    }
+
+}
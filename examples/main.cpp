@@ -46,7 +46,8 @@ int main(int argc, char *argv[]) {
     std::list<cofetcher::ClockOffsetService::tr_handle> handles;
     for(int i = 2; i < argc; i++) {
         cofetcher::endpoint endpoint(asio::ip::make_address("127.0.0.1"), std::stol(argv[i]));
-        handles.push_back(service.init_iterative_time_request(endpoint));
+        // fill all 20 offsets right away instead of one per interval
+        handles.push_back(service.init_iterative_time_request(endpoint, 10));
     }
 
     OffsetPrinter op(service);
@@ -6,6 +6,7 @@
 #define COFETCHER_CLOCK_OFFSET_H
 
 #include <chrono>
+#include <cstdint>
 
 typedef struct tp {
     int64_t initiator_time;
@@ -18,10 +19,17 @@ typedef struct tp {
 } time_pkg;
 
 
+inline int64_t get_current_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 time_pkg create_package();
 
 bool get_offset(time_pkg &package, int32_t &new_offset);
 
+bool get_round_trip_time(time_pkg &package, int32_t &round_trip_time);
+
 bool handle_package(time_pkg &package);
 
 #endif //COFETCHER_CLOCK_OFFSET_H
@@ -0,0 +1,60 @@
+#ifndef COFETCHER_CLOCK_OFFSET_STATE_H
+#define COFETCHER_CLOCK_OFFSET_STATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Layout of a state file: one peer_state_header followed by header.count peer_state records.
+ * All fields are fixed size and naturally aligned, so the file can be mapped into memory and
+ * the records read in place.
+ */
+
+constexpr uint32_t PEER_STATE_MAGIC = 0x436f4645; // "CoFE"
+constexpr uint32_t PEER_STATE_VERSION = 1;
+
+typedef struct psh {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+} peer_state_header;
+
+typedef struct ps {
+    // address bytes in network order, ipv4 addresses use the first 4 bytes
+    uint8_t address[16];
+    uint16_t port;
+    uint8_t is_v6;
+    uint8_t reserved;
+
+    // filtered offset in nanoseconds
+    int32_t offset;
+    // system clock time in nanoseconds at which the last offset was received
+    int64_t last_seen;
+    // smallest round trip time observed for this peer in nanoseconds
+    int32_t round_trip_time;
+    // number of offsets the filtered offset was calculated from
+    int32_t samples;
+} peer_state;
+
+static_assert(sizeof(peer_state_header) == 16, "peer_state_header must have a fixed layout");
+static_assert(sizeof(peer_state) == 40, "peer_state must have a fixed layout");
+
+/**
+ * write peer states to a file. the file is replaced atomically.
+ * @param path file to write to
+ * @param states states to write
+ * @return whether the file was written
+ */
+bool write_peer_states(const std::string &path, const std::vector<peer_state> &states);
+
+/**
+ * read peer states from a file
+ * @param path file to read from
+ * @param states read states are appended to this vector
+ * @return whether the file existed, had a valid layout and held all records announced in the header
+ */
+bool read_peer_states(const std::string &path, std::vector<peer_state> &states);
+
+#endif //COFETCHER_CLOCK_OFFSET_STATE_H
@@ -7,12 +7,19 @@
 
 #include "asio.hpp"
 #include "clock_offset.h"
+#include "clock_offset_state.h"
 #include <iostream>
 #include <map>
+#include <memory>
 #include <queue>
 #include <list>
 #include <random>
+#include <set>
+#include <condition_variable>
 #include <functional>
+#include <thread>
+#include <limits>
+#include <string>
 
 namespace cofetcher {
 
@@ -28,6 +35,10 @@ namespace cofetcher {
     typedef asio::ip::udp::endpoint endpoint;
 
 
+    /**
+     * udp service that measures clock offsets to other services.
+     * the async_* operations take any asio completion token, e.g. a callback or, with C++20, asio::use_awaitable.
+     */
     class ClockOffsetService { // TODO: handle failed sends
 
         class SynchronisedTimerWrapper;
@@ -47,6 +58,33 @@ namespace cofetcher {
         // TODO: list iterator as handle probably not clean code, but should be defined for std::list
         typedef Handle<cofetcher_callback*> callback_handle;
         typedef Handle<SynchronisedTimerWrapper*> tr_handle;
+
+        /**
+         * number of received packages that were dropped by admission control
+         */
+        struct rejection_counts {
+            // sender was not on the allowlist
+            uint64_t not_allowed = 0;
+            // sender exceeded its rate limit
+            uint64_t rate_limited = 0;
+            // sender endpoint was not tracked yet and the maximum number of tracked peers was reached
+            uint64_t too_many_peers = 0;
+        };
+
+        /**
+         * options of the busy poll run mode
+         */
+        struct busy_poll_options {
+            // cpu to pin the polling thread to while polling, -1 to not pin it.
+            // the previous affinity of the thread is restored when polling ends.
+            int cpu = -1;
+            // SO_BUSY_POLL value of the socket in microseconds, 0 to leave it unchanged
+            int socket_busy_poll = 0;
+            // how long to keep spinning after the last handled event before backing off
+            std::chrono::microseconds spin_duration{1000};
+            // how long to block in the reactor while backed off, 0 to never block
+            std::chrono::microseconds sleep_duration{100};
+        };
         
         /**
          * Constructor
@@ -56,12 +94,58 @@ namespace cofetcher {
         // TODO: discard all offsets older than a specified time
         ClockOffsetService(uint16_t port, uint16_t offset_counts, uint16_t max_repetition_interval = 5);
 
+        /**
+         * Constructor that warm starts from and periodically checkpoints to a state file
+         * @param port port to run udp server on
+         * @param offset_counts maximum amount of offsets to keep for each servie
+         * @param max_repetition_interval maximum interval between iterative time requests in seconds
+         * @param state_file file to load peer states from and to checkpoint peer states to
+         * @param checkpoint_interval interval in seconds in which peer states are written to state_file.
+         *      checkpoints are written by a separate thread, so file io does not delay received packages.
+         * @param max_state_age peer states older than this many seconds are discarded on load.
+         *      younger states are weighted less the older they are, so new offsets replace them faster.
+         */
+        ClockOffsetService(uint16_t port, uint16_t offset_counts, uint16_t max_repetition_interval,
+                const std::string &state_file, uint16_t checkpoint_interval = 10, uint32_t max_state_age = 3600);
+
+        /**
+         * Destructor. writes a final checkpoint if a state file is used.
+         */
+        ~ClockOffsetService();
+
         /**
          * keep sending time request to a specific endpoint
-         * @param endpoint endpoint to send the requests to
+         * @param endpoint endpoint to send the requests to. may be a multicast group, in which case every
+         *      member answering is tracked as its own endpoint.
+         * @param burst number of time requests to send back to back before falling back to the
+         *      regular interval, so offsets of new endpoints converge fast. 0 to start with the regular interval.
+         *      the two answers to each time request are not rate limited by 'limit_rate', unless endpoint is a
+         *      multicast group.
+         * @param burst_interval interval between time requests of the burst
          * @return handle to cancel new time requests
          */
-        tr_handle init_iterative_time_request(const asio::ip::udp::endpoint &endpoint);
+        tr_handle init_iterative_time_request(const asio::ip::udp::endpoint &endpoint, uint16_t burst = 0,
+                std::chrono::milliseconds burst_interval = std::chrono::milliseconds(5));
+
+        /**
+         * join a multicast group to answer time requests that are sent to the group.
+         * the group has to be probed on the port of this service.
+         * answers are sent unicast, so the requester keeps one offset per group member.
+         * call before running the service.
+         * @param group ipv4 multicast address to join
+         * @param interface address of the interface to join the group on. unspecified for the default interface.
+         */
+        void join_multicast_group(const asio::ip::address_v4 &group,
+                                  const asio::ip::address_v4 &interface = asio::ip::address_v4::any());
+
+        /**
+         * set the interface multicast time requests are sent from.
+         * to probe all members of a group with one package per round, pass an endpoint with the group address
+         * to 'init_iterative_time_request' or 'init_single_time_request'.
+         * call before running the service.
+         * @param interface address of the interface to send multicast packages from
+         */
+        void set_multicast_interface(const asio::ip::address_v4 &interface);
 
         /**
          * cancle time requests to an endpoint
@@ -75,6 +159,79 @@ namespace cofetcher {
          */
         void init_single_time_request(const asio::ip::udp::endpoint &endpoint);
 
+        /**
+         * asynchronously measure the offset to an endpoint.
+         * completes with the filtered offset of the first 'samples' offsets received from the endpoint,
+         * with asio::error::timed_out, or with asio::error::operation_aborted if cancelled with
+         * 'cancel_offset_waits'. lost time requests are not resent, so the timeout is required.
+         * @param endpoint unicast endpoint to measure the offset to.
+         *      a multicast group completes with asio::error::invalid_argument.
+         * @param samples number of offsets to collect. each time request yields two offsets.
+         * @param timeout time to wait for all samples. a timeout of 0 completes with asio::error::invalid_argument.
+         * @param token completion token with signature void(asio::error_code, int32_t offset)
+         */
+        template <typename CompletionToken>
+        ASIO_INITFN_RESULT_TYPE(CompletionToken, void (asio::error_code, int32_t))
+        async_time_request(const asio::ip::udp::endpoint &endpoint, std::size_t samples,
+                           std::chrono::milliseconds timeout, CompletionToken &&token) {
+            samples = std::max<std::size_t>(samples, 1);
+            return async_wait_for_samples(endpoint, samples, timeout, (samples + 1) / 2,
+                                          std::chrono::milliseconds(0), false, std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * asynchronously measure the offset to an endpoint with a burst of time requests.
+         * completes with the offset of the sample with the smallest round trip time, which is least
+         * affected by queuing delays. if the timeout expires before all samples were received, completes
+         * with the best sample received so far, or with asio::error::timed_out if there is none.
+         * the two answers to each time request of the burst are not rate limited by 'limit_rate'.
+         * @param endpoint unicast endpoint to measure the offset to.
+         *      a multicast group completes with asio::error::invalid_argument.
+         * @param exchanges number of time requests to send. each time request yields two offsets.
+         * @param interval interval between time requests
+         * @param timeout time to wait for all samples. a timeout of 0 completes with asio::error::invalid_argument.
+         * @param token completion token with signature void(asio::error_code, int32_t offset)
+         */
+        template <typename CompletionToken>
+        ASIO_INITFN_RESULT_TYPE(CompletionToken, void (asio::error_code, int32_t))
+        async_burst_time_request(const asio::ip::udp::endpoint &endpoint, std::size_t exchanges,
+                                 std::chrono::milliseconds interval, std::chrono::milliseconds timeout,
+                                 CompletionToken &&token) {
+            exchanges = std::max<std::size_t>(exchanges, 1);
+            return async_wait_for_samples(endpoint, 2 * exchanges, timeout, exchanges, interval, true,
+                                          std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * asynchronously wait for the next offset received from an endpoint.
+         * completes with the new offset, with asio::error::timed_out, or with asio::error::operation_aborted
+         * if cancelled with 'cancel_offset_waits'.
+         * @param endpoint unicast endpoint to wait for. group members answer from their own endpoints, so
+         *      a multicast group completes with asio::error::invalid_argument.
+         * @param timeout time to wait, 0 to wait until an offset is received or the wait is cancelled
+         * @param token completion token with signature void(asio::error_code, int32_t offset)
+         */
+        template <typename CompletionToken>
+        ASIO_INITFN_RESULT_TYPE(CompletionToken, void (asio::error_code, int32_t))
+        async_wait_offset(const asio::ip::udp::endpoint &endpoint, std::chrono::milliseconds timeout,
+                          CompletionToken &&token) {
+            return async_wait_for_samples(endpoint, 1, timeout, 0, std::chrono::milliseconds(0), false,
+                                          std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * cancel all pending asynchronous offset operations of an endpoint.
+         * they complete with asio::error::operation_aborted.
+         * @param endpoint endpoint to cancel operations of
+         * @return number of cancelled operations
+         */
+        std::size_t cancel_offset_waits(const asio::ip::udp::endpoint &endpoint);
+
+        /**
+         * @return the number of pending asynchronous offset operations.
+         */
+        std::size_t num_offset_waits();
+
         /**
          * @return the number of iterative time requests that are running.
          */
@@ -92,6 +249,54 @@ namespace cofetcher {
          */
         std::map<asio::ip::udp::endpoint, int32_t> get_offsets();
 
+        /**
+         * write the current peer states to the state file
+         * @return whether the state was written. false if no state file is used.
+         */
+        bool checkpoint_state();
+
+        /**
+         * limit the rate of packages answered per source address with a token bucket.
+         * packages exceeding the limit are dropped before being answered. buckets that refilled completely are
+         * forgotten, and at most 65536 source addresses are limited at once; packages of further sources are dropped.
+         * answers of an endpoint within a second of sending it a time request are not limited. this does not
+         * apply to answers of multicast group members, which count against their rate limit.
+         * @param packages_per_second rate tokens are refilled at. 0 disables rate limiting (default).
+         * @param bucket_size maximum number of tokens, i.e. packages accepted back to back
+         */
+        void limit_rate(double packages_per_second, double bucket_size);
+
+        /**
+         * limit the number of peer endpoints tracked by this service. packages of untracked endpoints are dropped
+         * before being answered if the limit is reached. peers that were idle for a minute are forgotten once the
+         * limit is reached.
+         * @param max_peers maximum number of peers. 0 disables the limit (default).
+         */
+        void limit_peers(std::size_t max_peers);
+
+        /**
+         * add an address to the allowlist
+         * @param address address to accept packages from in allowlist mode
+         */
+        void allow(const asio::ip::address &address);
+
+        /**
+         * in allowlist mode, only packages from addresses added with 'allow' are accepted.
+         * this includes answers of endpoints that this service sends time requests to.
+         * @param enabled whether allowlist mode is enabled (default=false)
+         */
+        void use_allowlist(bool enabled);
+
+        /**
+         * @return number of packages that were dropped by admission control
+         */
+        rejection_counts get_rejection_counts();
+
+        /**
+         * @return number of source addresses that currently have a rate limit token bucket
+         */
+        std::size_t num_rate_limited_sources();
+
         /**
          * listen for and send own time requests.
          */
@@ -108,6 +313,26 @@ namespace cofetcher {
             service.run_for(d);
         }
 
+        /**
+         * listen for and send own time requests by polling instead of sleeping in the reactor.
+         * this keeps the time between receiving a package and timestamping it low at the cost of a busy cpu.
+         * @param options options of the busy poll run mode
+         */
+        void run_busy_poll(const busy_poll_options &options);
+
+        /**
+         * run this service in busy poll mode for a specific duration
+         * @tparam Rep template parameter for duration
+         * @tparam Period template parameter for duration
+         * @param d duration to run this service for
+         * @param options options of the busy poll run mode
+         */
+        template <typename Rep, typename Period>
+        void run_busy_poll_for(std::chrono::duration<Rep, Period> d, const busy_poll_options &options) {
+            busy_poll_until(std::chrono::steady_clock::now()
+                    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(d), options);
+        }
+
         /**
          * subscribe to new offsets
          * @param callback callback to call if new offset was received.
@@ -128,7 +353,18 @@ namespace cofetcher {
 
     private:
         // keep sending time requests to endpoint
-        void iterative_time_request(const asio::ip::udp::endpoint endpoint, tr_handle::type handle);
+        void iterative_time_request(const asio::ip::udp::endpoint endpoint, tr_handle::type handle,
+                                    uint16_t burst, std::chrono::milliseconds burst_interval);
+
+        typedef std::function<void(const asio::error_code &error, int32_t offset)> offset_waiter_callback;
+        struct offset_waiter;
+
+        // send count time requests to endpoint, one every interval, while waiter is pending
+        void paced_time_requests(const asio::ip::udp::endpoint &endpoint, std::size_t count,
+                                 std::chrono::milliseconds interval, const std::weak_ptr<offset_waiter> &waiter);
+
+        // poll for events until the deadline is reached
+        void busy_poll_until(std::chrono::steady_clock::time_point deadline, const busy_poll_options &options);
 
         // initiate new receive
         void receive();
@@ -136,9 +372,69 @@ namespace cofetcher {
         // handle a received time package
         void receive_handler(const asio::error_code &error, std::size_t bytes_transferred);
 
+        // whether a package of endpoint should be handled, counts rejections. admission_mutex must not be locked
+        bool admit(const asio::ip::udp::endpoint &endpoint, const time_pkg &package);
+
+        // forget token buckets that refilled completely, admission_mutex needs to be locked
+        void sweep_token_buckets(std::chrono::steady_clock::time_point now);
+
+        // whether endpoint is tracked or may be tracked without exceeding max_peers
+        bool has_room_for_peer(const asio::ip::udp::endpoint &endpoint);
+
+        // start waiting for offsets of endpoint and send time requests for them
+        template <typename CompletionToken>
+        ASIO_INITFN_RESULT_TYPE(CompletionToken, void (asio::error_code, int32_t))
+        async_wait_for_samples(const asio::ip::udp::endpoint &endpoint, std::size_t samples,
+                               std::chrono::milliseconds timeout, std::size_t requests,
+                               std::chrono::milliseconds interval, bool min_round_trip_time,
+                               CompletionToken &&token) {
+            return asio::async_initiate<CompletionToken, void (asio::error_code, int32_t)>(
+                    [this, endpoint, samples, timeout, requests, interval, min_round_trip_time](auto &&handler) {
+                        // completion handlers may be move only, std::function needs a copyable target
+                        typedef typename std::decay<decltype(handler)>::type handler_type;
+                        auto shared = std::make_shared<handler_type>(std::move(handler));
+                        offset_waiter_callback complete = [this, shared](const asio::error_code &error,
+                                                                         int32_t offset) {
+                            auto executor = asio::get_associated_executor(*shared, service.get_executor());
+                            asio::post(executor, [shared, error, offset]() {
+                                std::move(*shared)(error, offset);
+                            });
+                        };
+                        // requests are not resent, so an operation sending them needs a timeout to finish.
+                        // offsets are never received from a multicast group, only from its members.
+                        if ((requests > 0 && timeout.count() <= 0) || endpoint.address().is_multicast()) {
+                            complete(asio::error::invalid_argument, 0);
+                            return;
+                        }
+                        auto waiter = add_offset_waiter(endpoint, samples, timeout, min_round_trip_time,
+                                                        std::move(complete));
+                        paced_time_requests(endpoint, requests, interval, waiter);
+                    }, token);
+        }
+
+        // register a callback that is called once samples offsets of endpoint were received or timeout expired
+        std::shared_ptr<offset_waiter> add_offset_waiter(const asio::ip::udp::endpoint &endpoint,
+                                                         std::size_t samples, std::chrono::milliseconds timeout,
+                                                         bool min_round_trip_time, offset_waiter_callback complete);
+
+        // pass a received offset to waiters of endpoint
+        void notify_offset_waiters(const asio::ip::udp::endpoint &endpoint, int32_t offset, int32_t round_trip_time);
+
+        // offset a waiter completes with
+        int32_t waiter_result(const offset_waiter &waiter);
+
         // send a time package to a endpoint
         void send(time_pkg &package, const asio::ip::udp::endpoint &endpoint);
 
+        // load peer states from state file
+        void load_state(uint32_t max_state_age);
+
+        // keep writing peer states to state file until checkpoint_stop is set, runs on checkpoint_thread
+        void iterative_checkpoint();
+
+        // calculate filtered offset of offsets, does not access members and needs no lock
+        static int32_t filtered_offset(const std::list<int32_t> &offsets);
+
         // io service that runs this service
         asio::io_service service;
 
@@ -149,13 +445,59 @@ namespace cofetcher {
         asio::ip::udp::endpoint sender_endpoint;
         std::array<char, sizeof(time_pkg)> buffer{};
 
+        // offsets and statistics collected for a single endpoint
+        struct offset_history {
+            std::list<int32_t> offsets;
+            // system clock time in nanoseconds the last offset was received at
+            int64_t last_seen = 0;
+            // smallest round trip time observed
+            int32_t min_round_trip_time = std::numeric_limits<int32_t>::max();
+            // samples of the loaded state while no new offset was received, 0 otherwise
+            int32_t restored_samples = 0;
+        };
+
         // map to collect offsets of all endpoints in question
         // TODO: user of the library should get more control over this data
         std::mutex offset_maps_mutex;
-        std::map<asio::ip::udp::endpoint, std::list<int32_t>> offset_maps;
+        std::map<asio::ip::udp::endpoint, offset_history> offset_maps;
+        // system clock time in nanoseconds peers were last checked for being idle
+        int64_t last_peer_sweep = 0;
         // parameter on how many offsets should be saved for each endpoint
         uint16_t offset_counts;
 
+        // token bucket of a single source address
+        struct token_bucket {
+            double tokens;
+            std::chrono::steady_clock::time_point last_seen;
+        };
+
+        // admission control of received packages
+        std::mutex admission_mutex;
+        std::map<asio::ip::address, token_bucket> token_buckets;
+        std::set<asio::ip::address> allowlist;
+        bool allowlist_enabled = false;
+        double rate = 0;
+        double bucket_size = 0;
+        std::size_t max_peers = 0;
+        std::chrono::steady_clock::time_point last_bucket_sweep;
+        // own time requests sent while rate limiting, keyed by endpoint and initiator_time.
+        // the matching package 1 and package 3 bypass the token buckets.
+        struct outstanding_request {
+            int32_t next_package_nr;
+            std::chrono::steady_clock::time_point sent;
+        };
+        std::map<std::pair<asio::ip::udp::endpoint, int64_t>, outstanding_request> outstanding_requests;
+        rejection_counts rejections;
+
+        // file to persist peer states in, empty if states should not be persisted
+        std::string state_file;
+        uint16_t checkpoint_interval = 0;
+        // guards checkpoint_stop and writing state_file
+        std::mutex checkpoint_mutex;
+        std::condition_variable checkpoint_condition;
+        bool checkpoint_stop = false;
+        std::thread checkpoint_thread;
+
         // tr_handles for iterative time requests
         std::mutex tr_handles_mutex;
         std::list<SynchronisedTimerWrapper> tr_handles;
@@ -168,6 +510,22 @@ namespace cofetcher {
         std::mutex callbacks_mutex;
         std::list<cofetcher_callback> callbacks;
 
+        // pending asynchronous operations waiting for offsets
+        struct offset_waiter {
+            offset_waiter(asio::io_service &service) : timer(service) {};
+
+            asio::ip::udp::endpoint endpoint;
+            std::size_t samples;
+            // whether to complete with the offset of smallest round trip time instead of the filtered offset
+            bool min_round_trip_time;
+            std::list<int32_t> offsets;
+            std::list<int32_t> round_trip_times;
+            offset_waiter_callback complete;
+            asio::steady_timer timer;
+        };
+        std::mutex waiters_mutex;
+        std::list<std::shared_ptr<offset_waiter>> waiters;
+
     private:
 
         class SynchronisedTimerWrapper {
@@ -1,23 +1,7 @@
 //
 // Created by oke on 6/29/19.
 //
-#include <chrono>
-
-typedef struct tp {
-    int64_t initiator_time;
-    int64_t receiver_time;
-
-    int32_t initiator_round_trip_time;
-    int32_t receiver_round_trip_time;
-
-    int32_t package_nr;
-} time_pkg;
-
-
-inline int64_t get_current_nanoseconds() {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
-}
+#include "clock_offset.h"
 
 time_pkg create_package() {
     time_pkg package;
@@ -46,6 +30,21 @@ bool get_offset(time_pkg &package, int32_t &new_offset) {
     return true;
 }
 
+bool get_round_trip_time(time_pkg &package, int32_t &round_trip_time) {
+    switch (package.package_nr) {
+        case 2: // handle as initiator
+            round_trip_time = package.initiator_round_trip_time;
+            break;
+        case 3: // handle as receiver
+        case 4: // handle as initiator
+            round_trip_time = package.receiver_round_trip_time;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
 bool handle_package(time_pkg &package) {
     switch (package.package_nr) {
         case 0: // handle as receiver
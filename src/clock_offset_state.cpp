@@ -0,0 +1,51 @@
+#include "clock_offset_state.h"
+#include <cstdio>
+#include <fstream>
+
+bool write_peer_states(const std::string &path, const std::vector<peer_state> &states) {
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        peer_state_header header{};
+        header.magic = PEER_STATE_MAGIC;
+        header.version = PEER_STATE_VERSION;
+        header.record_size = sizeof(peer_state);
+        header.count = (uint32_t) states.size();
+
+        file.write((const char *) &header, sizeof(header));
+        if (!states.empty())
+            file.write((const char *) states.data(), states.size() * sizeof(peer_state));
+        if (!file) return false;
+    }
+    // rename so that readers never see a partially written file
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool read_peer_states(const std::string &path, std::vector<peer_state> &states) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    peer_state_header header{};
+    if (!file.read((char *) &header, sizeof(header))) return false;
+    if (header.magic != PEER_STATE_MAGIC || header.version != PEER_STATE_VERSION
+        || header.record_size != sizeof(peer_state))
+        return false;
+
+    // a corrupt count must not make us allocate more than the file holds
+    std::streamoff records_begin = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - records_begin;
+    file.seekg(records_begin);
+    if (!file || remaining < 0 || (uint64_t) remaining < (uint64_t) header.count * sizeof(peer_state))
+        return false;
+
+    std::size_t offset = states.size();
+    states.resize(offset + header.count);
+    if (header.count && !file.read((char *) &states[offset], header.count * sizeof(peer_state))) {
+        states.resize(offset);
+        return false;
+    }
+    return true;
+}
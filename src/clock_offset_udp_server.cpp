@@ -4,39 +4,141 @@
 
 #include "clock_offset_udp_server.h"
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 constexpr const char * COSERVER_TAG = "ClockOffsetFetcherUDPServer";
 
+// peers that did not send anything for this long may be forgotten if the peer limit is reached
+constexpr std::chrono::seconds PEER_IDLE_TIMEOUT(60);
+
+// answers to own time requests are only exempt from rate limiting if they arrive within this time
+constexpr std::chrono::seconds REPLY_TIMEOUT(1);
+
+// upper bound of own time requests whose answers are exempt from rate limiting
+constexpr std::size_t MAX_OUTSTANDING_REQUESTS = 1 << 16;
+
+// upper bound of source addresses rate limited at once, packages of further sources are dropped
+constexpr std::size_t MAX_TOKEN_BUCKETS = 1 << 16;
+
 namespace cofetcher {
 
+#ifdef SO_BUSY_POLL
+    // socket option to busy poll the device queue on blocking receives, in microseconds
+    class busy_poll_socket_option {
+    public:
+        explicit busy_poll_socket_option(int value) : value(value) {};
+
+        template <typename Protocol>
+        int level(const Protocol &) const { return SOL_SOCKET; }
+
+        template <typename Protocol>
+        int name(const Protocol &) const { return SO_BUSY_POLL; }
+
+        template <typename Protocol>
+        const int *data(const Protocol &) const { return &value; }
+
+        template <typename Protocol>
+        std::size_t size(const Protocol &) const { return sizeof(value); }
+
+    private:
+        int value;
+    };
+#endif
+
+#ifdef __linux__
+    // pins the current thread to a cpu and restores its previous affinity when destroyed
+    class ScopedCpuAffinity {
+    public:
+        explicit ScopedCpuAffinity(int cpu) {
+            if (cpu < 0) return;
+            if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0) {
+#ifdef COFETCHER_DEBUG
+                std::cerr << COSERVER_TAG << "Could not get cpu affinity. Not pinning thread." << std::endl;
+#endif
+                return;
+            }
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(cpu, &cpu_set);
+            pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#ifdef COFETCHER_DEBUG
+            if (!pinned) {
+                std::cerr << COSERVER_TAG << "Could not pin thread to cpu " << cpu << ". Ignoring." << std::endl;
+            }
+#endif
+        }
+
+        ~ScopedCpuAffinity() {
+            if (pinned) pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+        }
+
+    private:
+        cpu_set_t previous;
+        bool pinned = false;
+    };
+#endif
+
     ClockOffsetService::ClockOffsetService(uint16_t port, uint16_t offset_counts, uint16_t max_repetition_interval)
             : service(), socket(service, asio::ip::udp::endpoint(asio::ip::udp::v4(), port)),
               tr_handles(), rd(), mt(rd()), dist(std::max(1., max_repetition_interval - 6.), std::min(1., (double) max_repetition_interval)), offset_counts(offset_counts) {
         receive();
     }
 
+    ClockOffsetService::ClockOffsetService(uint16_t port, uint16_t offset_counts, uint16_t max_repetition_interval,
+                                           const std::string &state_file, uint16_t checkpoint_interval,
+                                           uint32_t max_state_age)
+            : ClockOffsetService(port, offset_counts, max_repetition_interval) {
+        this->state_file = state_file;
+        this->checkpoint_interval = checkpoint_interval;
+        load_state(max_state_age);
+        if (checkpoint_interval > 0)
+            checkpoint_thread = std::thread([this]{ this->iterative_checkpoint(); });
+    }
+
+    ClockOffsetService::~ClockOffsetService() {
+        if (checkpoint_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(checkpoint_mutex);
+                checkpoint_stop = true;
+            }
+            checkpoint_condition.notify_all();
+            checkpoint_thread.join();
+        }
+        checkpoint_state();
+    }
+
     ClockOffsetService::tr_handle
-    ClockOffsetService::init_iterative_time_request(const asio::ip::udp::endpoint &endpoint) {
+    ClockOffsetService::init_iterative_time_request(const asio::ip::udp::endpoint &endpoint, uint16_t burst,
+                                                    std::chrono::milliseconds burst_interval) {
         tr_handle::type handle_value;
         {
             std::lock_guard<std::mutex> guard(tr_handles_mutex);
             tr_handles.emplace_back(service);
             handle_value = &*--tr_handles.end();
         }
-        iterative_time_request(endpoint, handle_value);
+        iterative_time_request(endpoint, handle_value, burst, burst_interval);
         handle_value->expires_from_now(std::chrono::seconds(0));
         return tr_handle(handle_value);
     }
 
     void ClockOffsetService::iterative_time_request(const asio::ip::udp::endpoint endpoint,
-                                                    const tr_handle::type handle) {
-        handle->expires_from_now(std::chrono::seconds((int) dist(mt)));
-        handle->async_wait([this, endpoint, handle](const asio::error_code &error) {
+                                                    const tr_handle::type handle, uint16_t burst,
+                                                    std::chrono::milliseconds burst_interval) {
+        if (burst > 0) {
+            handle->expires_from_now(burst_interval);
+        } else {
+            handle->expires_from_now(std::chrono::seconds((int) dist(mt)));
+        }
+        handle->async_wait([this, endpoint, handle, burst, burst_interval](const asio::error_code &error) {
             std::lock_guard<std::mutex> guard(tr_handles_mutex);
             // need to check for handle for the case that the handle was erased while entering this method
             for (auto it = tr_handles.begin(); it != tr_handles.end(); it++) {
                 if (&*it == handle) {
                     this->init_single_time_request(endpoint);
-                    this->iterative_time_request(endpoint, handle);
+                    this->iterative_time_request(endpoint, handle, burst > 0 ? burst - 1 : 0, burst_interval);
                     break;
                 }
             }
@@ -51,6 +153,15 @@ namespace cofetcher {
             [&handle](const SynchronisedTimerWrapper& item) { return &item == handle.handle_value; }));
     }
 
+    void ClockOffsetService::join_multicast_group(const asio::ip::address_v4 &group,
+                                                  const asio::ip::address_v4 &interface) {
+        socket.set_option(asio::ip::multicast::join_group(group, interface));
+    }
+
+    void ClockOffsetService::set_multicast_interface(const asio::ip::address_v4 &interface) {
+        socket.set_option(asio::ip::multicast::outbound_interface(interface));
+    }
+
     std::size_t ClockOffsetService::num_iterative_time_request() {
         std::lock_guard<std::mutex> guard(tr_handles_mutex);
         return tr_handles.size();
@@ -58,32 +169,166 @@ namespace cofetcher {
 
     void ClockOffsetService::init_single_time_request(const asio::ip::udp::endpoint &endpoint) {
         time_pkg pkg = create_package();
+        {
+            std::lock_guard<std::mutex> guard(admission_mutex);
+            if (rate > 0 && outstanding_requests.size() < MAX_OUTSTANDING_REQUESTS) {
+                outstanding_requests[std::make_pair(endpoint, pkg.initiator_time)] =
+                        outstanding_request{1, std::chrono::steady_clock::now()};
+            }
+        }
         send(pkg, endpoint);
     }
 
+    void ClockOffsetService::paced_time_requests(const asio::ip::udp::endpoint &endpoint, std::size_t count,
+                                                 std::chrono::milliseconds interval,
+                                                 const std::weak_ptr<offset_waiter> &waiter) {
+        if (count == 0) return;
+        {
+            // stop once the operation that requested the samples completed or was cancelled
+            std::lock_guard<std::mutex> guard(waiters_mutex);
+            auto pending = waiter.lock();
+            if (!pending || std::find(waiters.begin(), waiters.end(), pending) == waiters.end()) return;
+        }
+        init_single_time_request(endpoint);
+        if (count == 1) return;
+
+        if (interval.count() == 0) {
+            paced_time_requests(endpoint, count - 1, interval, waiter);
+            return;
+        }
+        auto timer = std::make_shared<asio::steady_timer>(service, interval);
+        timer->async_wait([this, timer, endpoint, count, interval, waiter](const asio::error_code &error) {
+            if (!error) this->paced_time_requests(endpoint, count - 1, interval, waiter);
+        });
+    }
+
+    std::shared_ptr<ClockOffsetService::offset_waiter>
+    ClockOffsetService::add_offset_waiter(const asio::ip::udp::endpoint &endpoint, std::size_t samples,
+                                               std::chrono::milliseconds timeout, bool min_round_trip_time,
+                                               offset_waiter_callback complete) {
+        auto waiter = std::make_shared<offset_waiter>(service);
+        waiter->endpoint = endpoint;
+        waiter->samples = samples;
+        waiter->min_round_trip_time = min_round_trip_time;
+        waiter->complete = std::move(complete);
+
+        std::lock_guard<std::mutex> guard(waiters_mutex);
+        waiters.push_back(waiter);
+        if (timeout.count() > 0) {
+            waiter->timer.expires_from_now(timeout);
+            waiter->timer.async_wait([this, waiter](const asio::error_code &) {
+                {
+                    std::lock_guard<std::mutex> guard(waiters_mutex);
+                    // the waiter is not in the list anymore if it completed in the meantime
+                    auto it = std::find(waiters.begin(), waiters.end(), waiter);
+                    if (it == waiters.end()) return;
+                    waiters.erase(it);
+                }
+                // a measurement based on the smallest round trip time is still useful with fewer samples
+                if (waiter->min_round_trip_time && !waiter->offsets.empty()) {
+                    waiter->complete(asio::error_code(), this->waiter_result(*waiter));
+                } else {
+                    waiter->complete(asio::error::timed_out, 0);
+                }
+            });
+        }
+        return waiter;
+    }
+
+    void ClockOffsetService::notify_offset_waiters(const asio::ip::udp::endpoint &endpoint, int32_t offset,
+                                                   int32_t round_trip_time) {
+        std::list<std::shared_ptr<offset_waiter>> completed;
+        {
+            std::lock_guard<std::mutex> guard(waiters_mutex);
+            for (auto it = waiters.begin(); it != waiters.end(); /* nothing */) {
+                offset_waiter &waiter = **it;
+                if (waiter.endpoint == endpoint) {
+                    waiter.offsets.push_back(offset);
+                    waiter.round_trip_times.push_back(round_trip_time);
+                }
+                if (waiter.offsets.size() >= waiter.samples) {
+                    waiter.timer.cancel();
+                    completed.push_back(*it);
+                    it = waiters.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        // complete outside the lock so handlers may start new operations
+        for (auto &waiter : completed) {
+            waiter->complete(asio::error_code(), waiter_result(*waiter));
+        }
+    }
+
+    std::size_t ClockOffsetService::cancel_offset_waits(const asio::ip::udp::endpoint &endpoint) {
+        std::list<std::shared_ptr<offset_waiter>> cancelled;
+        {
+            std::lock_guard<std::mutex> guard(waiters_mutex);
+            for (auto it = waiters.begin(); it != waiters.end(); /* nothing */) {
+                if ((*it)->endpoint == endpoint) {
+                    (*it)->timer.cancel();
+                    cancelled.push_back(*it);
+                    it = waiters.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for (auto &waiter : cancelled) {
+            waiter->complete(asio::error::operation_aborted, 0);
+        }
+        return cancelled.size();
+    }
+
+    std::size_t ClockOffsetService::num_offset_waits() {
+        std::lock_guard<std::mutex> guard(waiters_mutex);
+        return waiters.size();
+    }
+
+    int32_t ClockOffsetService::waiter_result(const offset_waiter &waiter) {
+        if (waiter.min_round_trip_time) {
+            auto offset_it = waiter.offsets.begin();
+            auto best_it = offset_it;
+            int32_t best_round_trip_time = std::numeric_limits<int32_t>::max();
+            for (int32_t round_trip_time : waiter.round_trip_times) {
+                if (round_trip_time < best_round_trip_time) {
+                    best_round_trip_time = round_trip_time;
+                    best_it = offset_it;
+                }
+                ++offset_it;
+            }
+            return *best_it;
+        }
+        return waiter.offsets.size() == 1 ? waiter.offsets.front() : filtered_offset(waiter.offsets);
+    }
+
     int32_t ClockOffsetService::get_offset_for(const asio::ip::udp::endpoint &endpoint) {
-        double s2 = 0;
-        double mean = 0;
         std::lock_guard<std::mutex> guard(offset_maps_mutex);
         auto offset_maps_it = offset_maps.find(endpoint);
         if (offset_maps_it != offset_maps.end()) {
-            std::list<int> &offsets = offset_maps_it->second;
-            for (int32_t &o : offsets) {
-                mean += (float) o / offsets.size();
-                s2 += (float) o * o / offsets.size();
-            }
-            double s = std::sqrt(s2);
-            double corrected_mean = mean;
-            for (int32_t &o : offsets) {
-                if (std::abs(o - mean) > 2 * s) {
-                    corrected_mean -= (float) o / offsets.size();
-                }
-            }
-            return (int32_t) corrected_mean;
+            return filtered_offset(offset_maps_it->second.offsets);
         }
         return 0;
     }
 
+    int32_t ClockOffsetService::filtered_offset(const std::list<int32_t> &offsets) {
+        double s2 = 0;
+        double mean = 0;
+        for (const int32_t &o : offsets) {
+            mean += (float) o / offsets.size();
+            s2 += (float) o * o / offsets.size();
+        }
+        double s = std::sqrt(s2);
+        double corrected_mean = mean;
+        for (const int32_t &o : offsets) {
+            if (std::abs(o - mean) > 2 * s) {
+                corrected_mean -= (float) o / offsets.size();
+            }
+        }
+        return (int32_t) corrected_mean;
+    }
+
     std::map<asio::ip::udp::endpoint, int32_t> ClockOffsetService::get_offsets() {
         std::list<endpoint> endpoints;
 
@@ -100,10 +345,270 @@ namespace cofetcher {
         return offsets;
     }
 
+    bool ClockOffsetService::checkpoint_state() {
+        if (state_file.empty()) return false;
+
+        std::vector<peer_state> states;
+        {
+            std::lock_guard<std::mutex> guard(offset_maps_mutex);
+            states.reserve(offset_maps.size());
+            for (auto &it : offset_maps) {
+                if (it.second.offsets.empty()) continue;
+                peer_state state{};
+                if (it.first.address().is_v6()) {
+                    auto bytes = it.first.address().to_v6().to_bytes();
+                    std::copy(bytes.begin(), bytes.end(), state.address);
+                    state.is_v6 = 1;
+                } else {
+                    auto bytes = it.first.address().to_v4().to_bytes();
+                    std::copy(bytes.begin(), bytes.end(), state.address);
+                }
+                state.port = it.first.port();
+                state.offset = filtered_offset(it.second.offsets);
+                state.last_seen = it.second.last_seen;
+                state.round_trip_time = it.second.min_round_trip_time;
+                // loaded states that were not refreshed keep their samples, so they only decay by age once
+                state.samples = it.second.restored_samples > 0
+                        ? it.second.restored_samples : (int32_t) it.second.offsets.size();
+                states.push_back(state);
+            }
+        }
+
+        bool written;
+        {
+            std::lock_guard<std::mutex> guard(checkpoint_mutex);
+            written = write_peer_states(state_file, states);
+        }
+#ifdef COFETCHER_DEBUG
+        if (!written) {
+            std::cerr << COSERVER_TAG << "Could not write state file " << state_file << "." << std::endl;
+        }
+#endif
+        return written;
+    }
+
+    void ClockOffsetService::load_state(uint32_t max_state_age) {
+        std::vector<peer_state> states;
+        if (!read_peer_states(state_file, states)) {
+#ifdef COFETCHER_DEBUG
+            std::cerr << COSERVER_TAG << "Could not read state file " << state_file << ". Starting cold." << std::endl;
+#endif
+            return;
+        }
+
+        const double max_age = max_state_age * 1e9;
+        const int64_t now = get_current_nanoseconds();
+
+        std::lock_guard<std::mutex> guard(offset_maps_mutex);
+        for (peer_state &state : states) {
+            double age = now - state.last_seen;
+            if (age < 0 || age >= max_age || state.samples <= 0) continue;
+
+            asio::ip::address address;
+            if (state.is_v6) {
+                asio::ip::address_v6::bytes_type bytes;
+                std::copy(state.address, state.address + bytes.size(), bytes.begin());
+                address = asio::ip::address_v6(bytes);
+            } else {
+                asio::ip::address_v4::bytes_type bytes;
+                std::copy(state.address, state.address + bytes.size(), bytes.begin());
+                address = asio::ip::address_v4(bytes);
+            }
+
+            // the older the state, the fewer samples it is worth, so new offsets take over faster
+            int32_t samples = std::min<int32_t>(state.samples, offset_counts);
+            auto weight = std::max<int32_t>(1, (int32_t) (samples * (1. - age / max_age)));
+
+            offset_history &history = offset_maps[endpoint(address, state.port)];
+            history.offsets.assign((std::size_t) weight, state.offset);
+            history.last_seen = state.last_seen;
+            history.min_round_trip_time = state.round_trip_time;
+            history.restored_samples = state.samples;
+        }
+    }
+
+    void ClockOffsetService::iterative_checkpoint() {
+        std::unique_lock<std::mutex> lock(checkpoint_mutex);
+        while (!checkpoint_condition.wait_for(lock, std::chrono::seconds(checkpoint_interval),
+                                              [this]{ return checkpoint_stop; })) {
+            lock.unlock();
+            checkpoint_state();
+            lock.lock();
+        }
+    }
+
+    void ClockOffsetService::limit_rate(double packages_per_second, double bucket_size) {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        this->rate = std::max(0., packages_per_second);
+        this->bucket_size = std::max(1., bucket_size);
+        token_buckets.clear();
+    }
+
+    std::size_t ClockOffsetService::num_rate_limited_sources() {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        return token_buckets.size();
+    }
+
+    void ClockOffsetService::limit_peers(std::size_t max_peers) {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        this->max_peers = max_peers;
+    }
+
+    void ClockOffsetService::allow(const asio::ip::address &address) {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        allowlist.insert(address);
+    }
+
+    void ClockOffsetService::use_allowlist(bool enabled) {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        allowlist_enabled = enabled;
+    }
+
+    ClockOffsetService::rejection_counts ClockOffsetService::get_rejection_counts() {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        return rejections;
+    }
+
+    bool ClockOffsetService::admit(const asio::ip::udp::endpoint &endpoint, const time_pkg &package) {
+        std::lock_guard<std::mutex> guard(admission_mutex);
+        const asio::ip::address address = endpoint.address();
+
+        if (allowlist_enabled && allowlist.find(address) == allowlist.end()) {
+            rejections.not_allowed++;
+            return false;
+        }
+
+        if (max_peers && !has_room_for_peer(endpoint)) {
+            rejections.too_many_peers++;
+            return false;
+        }
+
+        if (rate <= 0) return true;
+
+        auto now = std::chrono::steady_clock::now();
+        sweep_token_buckets(now);
+
+        // the two answers to each own time request, e.g. of a burst, do not count against the sender's rate
+        auto request_it = outstanding_requests.find(std::make_pair(endpoint, package.initiator_time));
+        if (request_it != outstanding_requests.end() && request_it->second.next_package_nr == package.package_nr
+            && now - request_it->second.sent < REPLY_TIMEOUT) {
+            if (package.package_nr == 1) {
+                request_it->second.next_package_nr = 3;
+            } else {
+                outstanding_requests.erase(request_it);
+            }
+            return true;
+        }
+
+        auto bucket_it = token_buckets.find(address);
+        if (bucket_it == token_buckets.end()) {
+            if (token_buckets.size() >= MAX_TOKEN_BUCKETS) {
+                rejections.rate_limited++;
+                return false;
+            }
+            bucket_it = token_buckets.emplace(address, token_bucket{bucket_size, now}).first;
+        }
+
+        token_bucket &bucket = bucket_it->second;
+        double elapsed = std::chrono::duration<double>(now - bucket.last_seen).count();
+        bucket.tokens = std::min(bucket_size, bucket.tokens + rate * elapsed);
+        bucket.last_seen = now;
+
+        if (bucket.tokens < 1) {
+            rejections.rate_limited++;
+            return false;
+        }
+        bucket.tokens -= 1;
+        return true;
+    }
+
+    void ClockOffsetService::sweep_token_buckets(std::chrono::steady_clock::time_point now) {
+        // at most once a second so floods of unknown sources stay cheap
+        if (now - last_bucket_sweep < std::chrono::seconds(1)) return;
+        last_bucket_sweep = now;
+
+        for (auto it = outstanding_requests.begin(); it != outstanding_requests.end(); /* nothing */) {
+            if (now - it->second.sent >= REPLY_TIMEOUT) {
+                it = outstanding_requests.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (auto it = token_buckets.begin(); it != token_buckets.end(); /* nothing */) {
+            // a bucket that refilled completely behaves like a new one and can be forgotten
+            double elapsed = std::chrono::duration<double>(now - it->second.last_seen).count();
+            if (it->second.tokens + rate * elapsed >= bucket_size) {
+                it = token_buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool ClockOffsetService::has_room_for_peer(const asio::ip::udp::endpoint &endpoint) {
+        std::lock_guard<std::mutex> guard(offset_maps_mutex);
+        if (offset_maps.find(endpoint) != offset_maps.end() || offset_maps.size() < max_peers) return true;
+
+        // make room by forgetting peers that went silent, at most once a second
+        int64_t now = get_current_nanoseconds();
+        if (now - last_peer_sweep < std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::seconds(1)).count())
+            return false;
+        last_peer_sweep = now;
+
+        int64_t idle_since = now - std::chrono::duration_cast<std::chrono::nanoseconds>(PEER_IDLE_TIMEOUT).count();
+        for (auto it = offset_maps.begin(); it != offset_maps.end(); /* nothing */) {
+            if (it->second.last_seen < idle_since) {
+                it = offset_maps.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return offset_maps.size() < max_peers;
+    }
+
     void ClockOffsetService::run() {
         service.run();
     }
 
+    void ClockOffsetService::run_busy_poll(const busy_poll_options &options) {
+        busy_poll_until(std::chrono::steady_clock::time_point::max(), options);
+    }
+
+    void ClockOffsetService::busy_poll_until(std::chrono::steady_clock::time_point deadline,
+                                             const busy_poll_options &options) {
+#ifdef __linux__
+        ScopedCpuAffinity affinity(options.cpu);
+#endif
+#ifdef SO_BUSY_POLL
+        if (options.socket_busy_poll > 0) {
+            asio::error_code error;
+            socket.set_option(busy_poll_socket_option(options.socket_busy_poll), error);
+#ifdef COFETCHER_DEBUG
+            if (error) {
+                std::cerr << COSERVER_TAG << "Error(" << error << ") setting SO_BUSY_POLL. Ignoring." << std::endl;
+            }
+#endif
+        }
+#endif
+
+        auto last_event = std::chrono::steady_clock::now();
+        while (!service.stopped()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) break;
+
+            if (service.poll() > 0) {
+                last_event = now;
+            } else if (options.sleep_duration.count() > 0 && now - last_event > options.spin_duration) {
+                // back off: block in the reactor, but wake up as soon as a package arrives
+                if (service.run_one_for(std::min<std::chrono::steady_clock::duration>(
+                        options.sleep_duration, deadline - now)) > 0)
+                    last_event = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
 
     /**
      * subscribe to new offsets
@@ -155,22 +660,34 @@ namespace cofetcher {
 #ifdef COFETCHER_DEBUG
             std::cerr << COSERVER_TAG << "Received message with invalid size. Ignoring";
 #endif
+            receive();
             return;
         }
 
         time_pkg &package = *(time_pkg *) buffer.data();
+        if (!admit(sender_endpoint, package)) {
+            receive();
+            return;
+        }
+
         if (handle_package(package)) {
             send(package, sender_endpoint);
         }
 
         int32_t offset;
         if (get_offset(package, offset)) {
+            int32_t round_trip_time = std::numeric_limits<int32_t>::max();
+            get_round_trip_time(package, round_trip_time);
             std::lock(offset_maps_mutex, callbacks_mutex);
             {
                 std::lock_guard<std::mutex> guard1(offset_maps_mutex, std::adopt_lock);
-                offset_maps[sender_endpoint].push_back(offset);
-                while (offset_maps[sender_endpoint].size() > offset_counts)
-                    offset_maps[sender_endpoint].pop_front();
+                offset_history &history = offset_maps[sender_endpoint];
+                history.offsets.push_back(offset);
+                history.restored_samples = 0;
+                while (history.offsets.size() > offset_counts)
+                    history.offsets.pop_front();
+                history.last_seen = get_current_nanoseconds();
+                history.min_round_trip_time = std::min(history.min_round_trip_time, round_trip_time);
             }
             {
                 std::lock_guard<std::mutex> guard(callbacks_mutex, std::adopt_lock);
@@ -187,6 +704,7 @@ namespace cofetcher {
                     }
                 }
             }
+            notify_offset_waiters(sender_endpoint, offset, round_trip_time);
         }
 
         receive();
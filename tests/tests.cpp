@@ -5,6 +5,8 @@
 
 #include "gtest/gtest.h"
 #include "clock_offset_udp_server.h"
+#include <fstream>
+#include <future>
 
 TEST(sample_test_case, iterative_time_requests)
 {
@@ -207,3 +209,596 @@ TEST(sample_test_case, callback_self_removal) {
     ASSERT_EQ(service1.num_callbacks(), 0);
 
 }
+
+TEST(sample_test_case, warm_start) {
+
+    const std::string state_file = "cofetcher_warm_start_test.bin";
+    std::remove(state_file.c_str());
+
+    {
+        cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 0);
+        cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+        ASSERT_EQ(service1.get_offsets().size(), 0);
+
+        auto h1 = service1.init_iterative_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+
+        std::thread thread([&]{
+            service1.run_for(std::chrono::milliseconds(500));
+        });
+
+        std::thread thread2([&]{
+            service2.run_for(std::chrono::milliseconds(500));
+        });
+
+        thread.join();
+        thread2.join();
+
+        service1.cancel_iterative_time_requests(h1);
+        ASSERT_EQ(service1.get_offsets().size(), 1);
+    }
+
+    cofetcher::ClockOffsetService service3(3000, 20, 1, state_file, 0);
+    auto offsets = service3.get_offsets();
+    ASSERT_EQ(offsets.size(), 1);
+    ASSERT_EQ(offsets.begin()->first, cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+    ASSERT_LT(std::abs(offsets.begin()->second), 1 * 1000 * 1000);
+
+    std::remove(state_file.c_str());
+}
+
+TEST(sample_test_case, warm_start_periodic_checkpoint) {
+
+    const std::string state_file = "cofetcher_checkpoint_test.bin";
+    std::remove(state_file.c_str());
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    service2.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+
+    std::thread thread([&]{
+        service1.run_for(std::chrono::milliseconds(1500));
+    });
+
+    std::thread thread2([&]{
+        service2.run_for(std::chrono::milliseconds(1500));
+    });
+
+    // the checkpoint after one second is written while the service is running
+    std::this_thread::sleep_for(std::chrono::milliseconds(1250));
+    std::vector<peer_state> states;
+    bool read = read_peer_states(state_file, states);
+
+    thread.join();
+    thread2.join();
+
+    ASSERT_TRUE(read);
+    ASSERT_EQ(states.size(), 1);
+    ASSERT_EQ(states[0].port, 3001);
+    ASSERT_GT(states[0].samples, 0);
+
+    std::remove(state_file.c_str());
+}
+
+TEST(sample_test_case, warm_start_corrupt_header) {
+
+    const std::string state_file = "cofetcher_corrupt_state_test.bin";
+
+    peer_state_header header{};
+    header.magic = PEER_STATE_MAGIC;
+    header.version = PEER_STATE_VERSION;
+    header.record_size = sizeof(peer_state);
+    header.count = 0xFFFFFFFF;
+    {
+        std::ofstream file(state_file, std::ios::binary | std::ios::trunc);
+        file.write((const char *) &header, sizeof(header));
+        file.write((const char *) &header, sizeof(header));
+    }
+
+    std::vector<peer_state> states;
+    ASSERT_FALSE(read_peer_states(state_file, states));
+    ASSERT_EQ(states.size(), 0);
+
+    // the service starts cold instead of failing
+    cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 0);
+    ASSERT_EQ(service1.get_offsets().size(), 0);
+
+    std::remove(state_file.c_str());
+}
+
+TEST(sample_test_case, warm_start_decays_once) {
+
+    const std::string state_file = "cofetcher_decay_state_test.bin";
+
+    peer_state state{};
+    state.address[0] = 127;
+    state.address[3] = 1;
+    state.port = 3001;
+    state.offset = 1000;
+    state.samples = 20;
+    state.last_seen = get_current_nanoseconds() - 1800 * 1000000000LL;
+    ASSERT_TRUE(write_peer_states(state_file, {state}));
+
+    // restarting without new offsets must not decay the state again
+    for (int i = 0; i < 3; i++) {
+        cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 0, 3600);
+    }
+
+    std::vector<peer_state> states;
+    ASSERT_TRUE(read_peer_states(state_file, states));
+    ASSERT_EQ(states.size(), 1);
+    ASSERT_EQ(states[0].samples, 20);
+    ASSERT_EQ(states[0].last_seen, state.last_seen);
+
+    std::remove(state_file.c_str());
+}
+
+TEST(sample_test_case, warm_start_discards_old_state) {
+
+    const std::string state_file = "cofetcher_old_state_test.bin";
+
+    peer_state state{};
+    state.address[0] = 127;
+    state.address[3] = 1;
+    state.port = 3001;
+    state.offset = 1000;
+    state.samples = 1;
+    state.last_seen = get_current_nanoseconds() - 2 * 3600 * 1000000000LL;
+    ASSERT_TRUE(write_peer_states(state_file, {state}));
+
+    {
+        cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 0, 3600);
+        ASSERT_EQ(service1.get_offsets().size(), 0);
+    }
+
+    state.last_seen = get_current_nanoseconds();
+    ASSERT_TRUE(write_peer_states(state_file, {state}));
+
+    {
+        cofetcher::ClockOffsetService service1(3000, 20, 1, state_file, 0, 3600);
+        ASSERT_EQ(service1.get_offset_for(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001)), 1000);
+    }
+
+    std::remove(state_file.c_str());
+}
+
+void run_services_for(std::chrono::milliseconds d, std::initializer_list<cofetcher::ClockOffsetService*> services) {
+    std::list<std::thread> threads;
+    for (auto service : services)
+        threads.emplace_back([service, d]{ service->run_for(d); });
+    for (auto &thread : threads)
+        thread.join();
+}
+
+TEST(sample_test_case, rate_limit) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    service1.limit_rate(1, 2);
+
+    for (int i = 0; i < 10; i++)
+        service2.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+
+    run_services_for(std::chrono::milliseconds(200), {&service1, &service2});
+
+    ASSERT_GE(service1.get_rejection_counts().rate_limited, 8);
+    ASSERT_EQ(service1.get_rejection_counts().not_allowed, 0);
+    ASSERT_EQ(service1.get_rejection_counts().too_many_peers, 0);
+}
+
+TEST(sample_test_case, allowlist_and_peer_limit) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    service1.use_allowlist(true);
+    service2.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+    run_services_for(std::chrono::milliseconds(200), {&service1, &service2});
+
+    ASSERT_EQ(service1.get_rejection_counts().not_allowed, 1);
+    ASSERT_EQ(service2.get_offsets().size(), 0);
+
+    service1.allow(asio::ip::make_address("127.0.0.1"));
+    service2.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+    run_services_for(std::chrono::milliseconds(200), {&service1, &service2});
+
+    ASSERT_EQ(service1.get_rejection_counts().not_allowed, 1);
+    ASSERT_EQ(service2.get_offsets().size(), 1);
+    ASSERT_EQ(service1.get_offsets().size(), 1);
+
+    // a second peer with a different port is tracked separately and exceeds the limit
+    cofetcher::ClockOffsetService service3(3002, 20, 1);
+    service1.limit_peers(1);
+    service3.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+    run_services_for(std::chrono::milliseconds(200), {&service1, &service3});
+
+    // the time request of the untracked peer is dropped before it is answered
+    ASSERT_EQ(service1.get_rejection_counts().too_many_peers, 1);
+    ASSERT_EQ(service1.get_offsets().size(), 1);
+    ASSERT_EQ(service3.get_offsets().size(), 0);
+}
+
+TEST(sample_test_case, rate_limit_many_sources) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    service1.limit_rate(10, 2);
+
+    // send a time request from many loopback addresses, as a flood with spoofed sources would
+    asio::io_service io_service;
+    time_pkg package = create_package();
+    cofetcher::endpoint endpoint1(asio::ip::make_address("127.0.0.1"), 3000);
+    for (int i = 1; i <= 200; i++) {
+        asio::ip::udp::socket socket(io_service, cofetcher::endpoint(
+                asio::ip::address_v4(0x7f000100 + i), 0));
+        socket.send_to(asio::buffer(&package, sizeof(package)), endpoint1);
+    }
+
+    service1.run_for(std::chrono::milliseconds(200));
+    ASSERT_EQ(service1.num_rate_limited_sources(), 200);
+
+    // once their buckets refilled, the sources are forgotten with the next package
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    asio::ip::udp::socket socket(io_service, cofetcher::endpoint(asio::ip::make_address("127.0.0.2"), 0));
+    socket.send_to(asio::buffer(&package, sizeof(package)), endpoint1);
+    service1.run_for(std::chrono::milliseconds(200));
+
+    ASSERT_EQ(service1.num_rate_limited_sources(), 1);
+    ASSERT_EQ(service1.get_rejection_counts().rate_limited, 0);
+}
+
+TEST(sample_test_case, busy_poll) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    auto h1 = service1.init_iterative_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+
+    cofetcher::ClockOffsetService::busy_poll_options options;
+    options.cpu = 0;
+    options.spin_duration = std::chrono::microseconds(100);
+
+    std::thread thread([&]{
+        service1.run_busy_poll_for(std::chrono::milliseconds(300), options);
+    });
+
+    std::thread thread2([&]{
+        service2.run_for(std::chrono::milliseconds(300));
+    });
+
+    thread.join();
+    thread2.join();
+
+    auto offsets = service1.get_offsets();
+    ASSERT_EQ(offsets.size(), 1);
+    ASSERT_LT(std::abs(offsets.begin()->second), 1 * 1000 * 1000);
+
+    service1.cancel_iterative_time_requests(h1);
+}
+
+TEST(sample_test_case, busy_poll_backoff) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    // back off right away and block for longer than the test runs
+    cofetcher::ClockOffsetService::busy_poll_options options;
+    options.spin_duration = std::chrono::microseconds(0);
+    options.sleep_duration = std::chrono::seconds(10);
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration run_duration;
+    std::thread thread([&]{
+        service1.run_busy_poll_for(std::chrono::milliseconds(500), options);
+        run_duration = std::chrono::steady_clock::now() - start;
+    });
+
+    std::thread thread2([&]{
+        service2.run_for(std::chrono::milliseconds(500));
+    });
+
+    // service1 is backed off by now and has to wake up for the time request
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    service2.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000));
+
+    thread.join();
+    thread2.join();
+
+    ASSERT_LT(run_duration, std::chrono::seconds(1));
+    ASSERT_EQ(service1.get_offsets().size(), 1);
+    ASSERT_EQ(service2.get_offsets().size(), 1);
+}
+
+TEST(sample_test_case, multicast) {
+
+    auto group = asio::ip::make_address_v4("239.255.42.1");
+    auto loopback = asio::ip::address_v4::loopback();
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    service1.set_multicast_interface(loopback);
+    service2.join_multicast_group(group, loopback);
+
+    auto h1 = service1.init_iterative_time_request(cofetcher::endpoint(group, 3001));
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    // the group member answers unicast and is tracked under its own endpoint
+    auto offsets = service1.get_offsets();
+    ASSERT_EQ(offsets.size(), 1);
+    ASSERT_EQ(offsets.begin()->first.port(), 3001);
+    ASSERT_FALSE(offsets.begin()->first.address().is_multicast());
+    ASSERT_LT(std::abs(offsets.begin()->second), 1 * 1000 * 1000);
+    ASSERT_EQ(service2.get_offsets().size(), 1);
+
+    service1.cancel_iterative_time_requests(h1);
+}
+
+TEST(sample_test_case, async_time_request) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    cofetcher::endpoint endpoint2(asio::ip::make_address("127.0.0.1"), 3001);
+    cofetcher::endpoint endpoint3(asio::ip::make_address("127.0.0.1"), 3002);
+
+    int completions = 0;
+    asio::error_code measure_error = asio::error::would_block;
+    int32_t measured_offset = -1;
+    service1.async_time_request(endpoint2, 4, std::chrono::milliseconds(200),
+                                [&](const asio::error_code &error, int32_t offset) {
+        completions++;
+        measure_error = error;
+        measured_offset = offset;
+    });
+
+    asio::error_code wait_error = asio::error::would_block;
+    service2.async_wait_offset(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3000),
+                               std::chrono::milliseconds(0), [&](const asio::error_code &error, int32_t offset) {
+        completions++;
+        wait_error = error;
+    });
+
+    asio::error_code timeout_error;
+    service1.async_wait_offset(endpoint3, std::chrono::milliseconds(50),
+                               [&](const asio::error_code &error, int32_t offset) {
+        completions++;
+        timeout_error = error;
+    });
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    ASSERT_EQ(completions, 3);
+    ASSERT_FALSE(measure_error);
+    ASSERT_LT(std::abs(measured_offset), 1 * 1000 * 1000);
+    ASSERT_FALSE(wait_error);
+    ASSERT_EQ(timeout_error, asio::error::timed_out);
+}
+
+TEST(sample_test_case, async_time_request_cancel) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+
+    cofetcher::endpoint endpoint3(asio::ip::make_address("127.0.0.1"), 3002);
+
+    // time requests are not resent, so measuring without a timeout is rejected
+    asio::error_code measure_error;
+    service1.async_time_request(endpoint3, 4, std::chrono::milliseconds(0),
+                                [&](const asio::error_code &error, int32_t offset) {
+        measure_error = error;
+    });
+
+    asio::error_code wait_error;
+    service1.async_wait_offset(endpoint3, std::chrono::milliseconds(0),
+                               [&](const asio::error_code &error, int32_t offset) {
+        wait_error = error;
+    });
+
+    // offsets are received from group members, never from the group
+    asio::error_code group_error;
+    service1.async_wait_offset(cofetcher::endpoint(asio::ip::make_address("239.255.42.1"), 3001),
+                               std::chrono::milliseconds(0), [&](const asio::error_code &error, int32_t offset) {
+        group_error = error;
+    });
+
+    ASSERT_EQ(service1.num_offset_waits(), 1);
+    ASSERT_EQ(service1.cancel_offset_waits(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001)), 0);
+    ASSERT_EQ(service1.cancel_offset_waits(endpoint3), 1);
+    ASSERT_EQ(service1.num_offset_waits(), 0);
+
+    service1.run_for(std::chrono::milliseconds(100));
+
+    ASSERT_EQ(measure_error, asio::error::invalid_argument);
+    ASSERT_EQ(wait_error, asio::error::operation_aborted);
+    ASSERT_EQ(group_error, asio::error::invalid_argument);
+}
+
+#if defined(ASIO_HAS_CO_AWAIT)
+TEST(sample_test_case, async_time_request_coroutine) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    std::promise<int32_t> measured_offset;
+    asio::co_spawn(asio::system_executor(), [&]() -> asio::awaitable<void> {
+        measured_offset.set_value(co_await service1.async_time_request(
+                cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001), 4,
+                std::chrono::milliseconds(200), asio::use_awaitable));
+    }, asio::detached);
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    auto future = measured_offset.get_future();
+    ASSERT_EQ(future.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    ASSERT_LT(std::abs(future.get()), 1 * 1000 * 1000);
+}
+#endif
+
+TEST(sample_test_case, burst) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    int callback_calls = 0;
+    auto callback = service1.subscribe([&callback_calls](cofetcher::endpoint &endpoint, int32_t offset,
+                                                         int32_t filterd_offset, bool &remove_callback) {
+        callback_calls++;
+    });
+
+    // without a burst, only a single time request would be sent within the first second
+    auto h1 = service1.init_iterative_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001),
+                                                   10, std::chrono::milliseconds(5));
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    // two offsets per exchange
+    ASSERT_GE(callback_calls, 2 * 10);
+
+    service1.cancel_iterative_time_requests(h1);
+    service1.unsubscribe(callback);
+}
+
+TEST(sample_test_case, burst_time_request) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    // answers to the burst are not rate limited
+    service1.limit_rate(1, 1);
+
+    int callback_calls = 0;
+    auto callback = service1.subscribe([&callback_calls](cofetcher::endpoint &endpoint, int32_t offset,
+                                                         int32_t filterd_offset, bool &remove_callback) {
+        callback_calls++;
+    });
+
+    std::chrono::steady_clock::duration burst_duration;
+    asio::error_code burst_error = asio::error::would_block;
+    int32_t burst_offset = -1;
+    auto start = std::chrono::steady_clock::now();
+    service1.async_burst_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001), 8,
+                                      std::chrono::milliseconds(1), std::chrono::milliseconds(200),
+                                      [&](const asio::error_code &error, int32_t offset) {
+        burst_duration = std::chrono::steady_clock::now() - start;
+        burst_error = error;
+        burst_offset = offset;
+    });
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    ASSERT_FALSE(burst_error);
+    ASSERT_LT(burst_duration, std::chrono::milliseconds(100));
+    ASSERT_LT(std::abs(burst_offset), 1 * 1000 * 1000);
+    ASSERT_EQ(callback_calls, 2 * 8);
+    ASSERT_EQ(service1.get_rejection_counts().rate_limited, 0);
+
+    service1.unsubscribe(callback);
+}
+
+TEST(sample_test_case, burst_time_request_min_round_trip_time) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+
+    // a peer that answers the second time request right away, claiming a clock 5ms ahead,
+    // and the others after 30ms, claiming the same clock
+    asio::io_service io_service;
+    asio::ip::udp::socket peer(io_service, cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+    std::thread peer_thread([&]{
+        std::list<time_pkg> delayed;
+        cofetcher::endpoint sender;
+        for (int i = 0; i < 3; i++) {
+            time_pkg package;
+            peer.receive_from(asio::buffer(&package, sizeof(package)), sender);
+            package.package_nr = 1;
+            if (i == 1) {
+                package.receiver_time = package.initiator_time + 5 * 1000 * 1000;
+                peer.send_to(asio::buffer(&package, sizeof(package)), sender);
+            } else {
+                package.receiver_time = package.initiator_time;
+                delayed.push_back(package);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        for (auto &package : delayed)
+            peer.send_to(asio::buffer(&package, sizeof(package)), sender);
+    });
+
+    // the peer never sends the last package of an exchange, so only the timeout completes the measurement
+    asio::error_code burst_error = asio::error::would_block;
+    int32_t burst_offset = 0;
+    service1.async_burst_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001), 3,
+                                      std::chrono::milliseconds(1), std::chrono::milliseconds(200),
+                                      [&](const asio::error_code &error, int32_t offset) {
+        burst_error = error;
+        burst_offset = offset;
+    });
+
+    service1.run_for(std::chrono::milliseconds(300));
+    peer_thread.join();
+
+    ASSERT_FALSE(burst_error);
+    ASSERT_GT(burst_offset, 4 * 1000 * 1000);
+    ASSERT_LE(burst_offset, 5 * 1000 * 1000);
+}
+
+TEST(sample_test_case, rate_limit_forged_answers) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    service1.limit_rate(1, 1);
+
+    asio::io_service io_service;
+    asio::ip::udp::socket peer(io_service, cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+
+    service1.init_single_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001));
+
+    std::thread thread([&]{
+        service1.run_for(std::chrono::milliseconds(300));
+    });
+
+    time_pkg package;
+    cofetcher::endpoint sender;
+    peer.receive_from(asio::buffer(&package, sizeof(package)), sender);
+    package.package_nr = 1;
+    package.receiver_time = get_current_nanoseconds();
+    peer.send_to(asio::buffer(&package, sizeof(package)), sender);
+
+    // replays of the answer and answers to requests that were never sent count against the rate
+    peer.send_to(asio::buffer(&package, sizeof(package)), sender);
+    for (int i = 1; i <= 20; i++) {
+        time_pkg forged = package;
+        forged.initiator_time += i;
+        peer.send_to(asio::buffer(&forged, sizeof(forged)), sender);
+    }
+
+    thread.join();
+
+    ASSERT_GE(service1.get_rejection_counts().rate_limited, 20);
+}
+
+TEST(sample_test_case, burst_time_request_stops_sending) {
+
+    cofetcher::ClockOffsetService service1(3000, 20, 1);
+    cofetcher::ClockOffsetService service2(3001, 20, 1);
+
+    int requests = 0;
+    auto callback = service2.subscribe([&requests](cofetcher::endpoint &, int32_t, int32_t, bool &) {
+        requests++;
+    });
+
+    // completes after 50ms, the remaining time requests of the burst must not be sent
+    asio::error_code burst_error = asio::error::would_block;
+    service1.async_burst_time_request(cofetcher::endpoint(asio::ip::make_address("127.0.0.1"), 3001), 1000,
+                                      std::chrono::milliseconds(10), std::chrono::milliseconds(50),
+                                      [&](const asio::error_code &error, int32_t) {
+        burst_error = error;
+    });
+
+    run_services_for(std::chrono::milliseconds(300), {&service1, &service2});
+
+    ASSERT_FALSE(burst_error);
+    ASSERT_LE(requests, 7);
+
+    service2.unsubscribe(callback);
+}